@@ -1,12 +1,35 @@
-#include <omp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
-#define CACHE_SIZE 2
-#define MEMORY_SIZE 24
+#define CACHE_SIZE 4     // Lines per core.
+#define LINE_SIZE 64     // Bytes per line.
+#define MEMORY_SIZE 1024
+
+// Default interconnect timing, in simulated cycles.
+#define HIT_CYCLES 1
+#define BUS_CYCLES 4     // Bus occupancy per transaction.
+#define DRAM_CYCLES 40   // DRAM channel occupancy per line transfer.
+#define DRAM_CHANNELS 2
+#define QUEUE_CAPACITY 8 // Requests a resource can hold before it back-pressures.
+
+#define SAMPLE_PERIOD 64 // Accesses between checks in sampled checking mode.
+
+#define NUM_CORES 2
+#define MAX_CORES 64
+#define MAX_SWEEP_VALUES 16 // Values per swept parameter.
+
+#define RING_CAPACITY 1024 // Interval records buffered before they are written out.
 
 typedef char byte;
 
@@ -22,57 +45,302 @@ enum operation_type
   Read = 0,
   Write = 1
 };
+enum arbitration_policy
+{
+  RoundRobin,
+  FixedPriority
+};
 
 typedef enum cache_state cache_state;
 typedef enum operation_type operation_type;
+enum check_mode
+{
+  CheckOff,
+  CheckSampled,
+  CheckFull
+};
+enum sweep_parameter
+{
+  ParamCores,
+  ParamLineSize,
+  ParamLines,
+  ParamBusCycles,
+  ParamDramCycles,
+  ParamChannels,
+  ParamQueue,
+  ParamArbitration,
+  NumParams
+};
+enum job_status
+{
+  JobPending,
+  JobRunning,
+  JobDone
+};
+
+typedef enum arbitration_policy arbitration_policy;
+typedef enum check_mode check_mode;
+typedef enum sweep_parameter sweep_parameter;
+typedef enum job_status job_status;
 
 struct cache_entry
 {
-  byte address;      // Memory address.
-  byte data;         // Stored value.
+  int tag;           // Line number held (address / line size).
+  byte *data;        // Line contents, carved out of the shared line arena.
   cache_state state; // State for MESI protocol.
 };
 
 struct instruction
 {
   operation_type operation; // 0 for Read, 1 for Write.
-  byte address;
-  byte data; // Only used for Write.
+  int address;
+  byte data;       // Only used for Write.
+  int line_number; // Line of the input file it was decoded from.
+};
+
+struct cache_config
+{
+  int line_size;   // Bytes per line, a power of two (32, 64, 128, ...).
+  int num_lines;   // Direct-mapped lines per core.
+  int memory_size; // Bytes of global memory, a multiple of the line size.
+};
+
+// Bus and memory traffic generated by a single instruction.
+struct transaction
+{
+  bool bus;       // Needs the shared bus (miss or invalidation broadcast).
+  bool fill;      // Line is fetched from memory rather than a peer cache.
+  bool writeback; // Evicted line is flushed to memory.
+  bool flush;     // A peer's dirty copy is flushed to memory as it is shared.
+  bool miss;      // Line was not valid in the issuing core's cache.
+  int invalidations; // Peer copies invalidated by a write.
+  int victim;     // Line number of the evicted line, if any.
+};
+
+struct interconnect_config
+{
+  int hit_cycles;
+  int bus_cycles;
+  int dram_cycles;
+  int dram_channels;
+  int queue_capacity;
+  arbitration_policy arbitration;
+};
+
+// A shared resource with finite bandwidth: one grant at a time, each holding it
+// for a fixed occupancy, with a bounded queue of in-flight requests.
+struct resource
+{
+  char name[16];
+  long free_at;          // Cycle at which the next grant can start.
+  long *completions;     // Ring of completion cycles for in-flight requests.
+  int capacity;
+  int head;
+  int count;
+  long requests;
+  long busy_cycles;
+  long wait_cycles;
+  long *depth_histogram; // Queue depth seen on arrival, 0..capacity.
+};
+
+struct core_timing
+{
+  long ready_at;     // Cycle at which the core can issue its next instruction.
+  long stall_cycles; // Cycles spent waiting on the bus or DRAM.
+  long transactions;
+  long instructions; // Instructions issued so far, i.e. position in the trace.
+  long misses;
+  long invalidations; // Peer copies invalidated by this core's writes.
 };
 
 typedef struct cache_entry cache_entry;
 typedef struct instruction instruction;
+typedef struct cache_config cache_config;
+typedef struct transaction transaction;
+typedef struct interconnect_config interconnect_config;
+typedef struct resource resource;
+typedef struct core_timing core_timing;
+
+struct interconnect
+{
+  interconnect_config config;
+  resource bus;
+  resource *channels;
+  int last_granted; // Core granted most recently, for round-robin arbitration.
+};
+
+typedef struct interconnect interconnect;
+
+// Online coherence checker. Accesses are serviced one at a time, so applying
+// every write to a flat copy of memory in service order gives the sequentially
+// consistent value each read must return.
+struct checker
+{
+  check_mode mode;
+  int sample_period; // Validate every Nth access in sampled mode.
+  byte *golden;      // Reference copy of memory.
+  long accesses;     // Accesses serviced so far, across all cores.
+  long checks;       // Accesses actually validated.
+  int line_number;   // Input file line of the access being validated.
+};
+
+typedef struct checker checker;
+
+struct sim_config
+{
+  int num_cores;
+  cache_config cache;
+  interconnect_config interconnect;
+  check_mode check;
+  int sample_period;
+};
+
+struct sim_result
+{
+  long cycles;
+  long accesses;
+  long misses;
+  long bus_requests;
+  long bus_busy_cycles;
+  long bus_wait_cycles;
+  long dram_busy_cycles; // Summed over all channels.
+};
+
+// Decoded instruction streams for every core in one contiguous block, so the
+// whole set can be copied into a shared-memory segment and used in place.
+struct trace_set
+{
+  size_t size; // Bytes in the block, header included.
+  int num_cores;
+  int min_address;
+  int max_address;
+  long lengths[MAX_CORES];
+  long offsets[MAX_CORES]; // Index of each core's first instruction.
+  instruction instructions[];
+};
+
+struct sweep_axis
+{
+  int values[MAX_SWEEP_VALUES];
+  int count;
+};
+
+struct sweep_job
+{
+  struct sim_config config;
+  struct sim_result result;
+  job_status status;
+  pid_t worker;
+};
+
+// Lives in shared memory: workers claim jobs from `next_job` until none remain.
+struct sweep_state
+{
+  atomic_int next_job;
+  int num_jobs;
+  struct sweep_job jobs[];
+};
+
+typedef struct sim_config sim_config;
+typedef struct sim_result sim_result;
+typedef struct trace_set trace_set;
+typedef struct sweep_axis sweep_axis;
+typedef struct sweep_job sweep_job;
+typedef struct sweep_state sweep_state;
+
+// One core's activity over a sampling interval.
+struct core_interval
+{
+  long accesses;
+  long misses;
+  long transactions;
+  long invalidations;
+  int lines[4]; // Lines in each MESI state at the end of the interval, by cache_state.
+};
+
+struct interval_record
+{
+  long index;
+  long cycle;    // Simulated cycle at which the interval closed.
+  long accesses; // Accesses serviced so far, across all cores.
+  struct core_interval cores[];
+};
+
+// Ring of interval records in a POSIX shared-memory segment, so that a status
+// reader (-W <pid>) can follow a run while it is in progress.
+struct status_segment
+{
+  int num_cores;
+  int capacity;
+  size_t record_size;
+  long total_accesses; // Accesses in the whole trace, for progress.
+  atomic_long written; // Records written so far; the newest is at written - 1.
+  atomic_int done;
+  _Alignas(max_align_t) unsigned char records[]; // Aligned for interval_record.
+};
+
+struct timeline
+{
+  long interval_accesses; // Close an interval every N accesses, 0 for never.
+  long interval_cycles;   // Close an interval every N cycles, 0 for never.
+  long next_access;
+  long next_cycle;
+  long accesses;
+  long records;        // Records written to the ring.
+  long flushed;        // Records already written to the timeline file.
+  FILE *out;           // Timeline file, or NULL for status only.
+  bool json;           // Chrome trace-event JSON rather than CSV.
+  bool first_event;
+  core_timing *previous; // Per-core counters at the last interval boundary.
+  struct status_segment *status;
+  size_t status_size;
+};
+
+typedef struct core_interval core_interval;
+typedef struct interval_record interval_record;
+typedef struct status_segment status_segment;
+typedef struct timeline timeline;
 
 byte *global_memory;
+bool print_accesses = true;
+char status_name[32]; // Name of this run's status segment, if it has one.
+timeline *active_timeline; // Timeline to close if the run exits early.
+pid_t timeline_owner;      // Process that owns it; forked children leave it alone.
 
-instruction parse_instruction(const char *line)
+// Decode one trace line into `instr`. Returns false if the line is not a
+// well-formed RD or WR instruction.
+bool parse_instruction(const char *line, instruction *instr)
 {
-  instruction instr;
-  char op_type[3];
-  sscanf(line, "%s", op_type);
+  char op_type[8];
+  if (sscanf(line, "%7s", op_type) != 1)
+    return false;
   if (!strcmp(op_type, "RD"))
   {
     int addr = 0;
-    sscanf(line, "%s %d", op_type, &addr);
-    instr.operation = Read;
-    instr.data = -1;
-    instr.address = addr;
+    if (sscanf(line, "%7s %d", op_type, &addr) != 2)
+      return false;
+    instr->operation = Read;
+    instr->data = -1;
+    instr->address = addr;
+    return true;
   }
   else if (!strcmp(op_type, "WR"))
   {
     int addr = 0;
     int val = 0;
-    sscanf(line, "%s %d %d", op_type, &addr, &val);
-    instr.operation = Write;
-    instr.address = addr;
-    instr.data = val;
+    if (sscanf(line, "%7s %d %d", op_type, &addr, &val) != 3)
+      return false;
+    instr->operation = Write;
+    instr->address = addr;
+    instr->data = val;
+    return true;
   }
-  return instr;
+  return false;
 }
 
-void display_cache_entries(const cache_entry *cache, int cache_size)
+void display_cache_entries(const cache_entry *cache, const cache_config *cfg)
 {
-  for (int i = 0; i < cache_size; i++)
+  for (int i = 0; i < cfg->num_lines; i++)
   {
     cache_entry entry = *(cache + i);
     char state_str[10];
@@ -91,91 +359,783 @@ void display_cache_entries(const cache_entry *cache, int cache_size)
       strncpy(state_str, "Modified", sizeof(state_str));
       break;
     }
-    printf("\t\tAddress: %d, State: %s, Data: %d\n", entry.address, state_str, entry.data);
+    printf("\t\tLine: %d (addresses %d-%d), State: %s, Data:", entry.tag,
+           entry.tag * cfg->line_size, (entry.tag + 1) * cfg->line_size - 1, state_str);
+    for (int offset = 0; offset < cfg->line_size; offset++)
+      printf(" %02x", (unsigned char)entry.data[offset]);
+    printf("\n");
   }
 }
 
-void process_instruction(cache_entry **core_cache, int num_cores, int core_id, instruction instr)
+// Word-level access into a line. Trace instructions are byte-wide, so the
+// simulator only ever moves single bytes, but the line holds the full block.
+byte read_line_word(const cache_entry *entry, int offset)
 {
-  int hash = instr.address % CACHE_SIZE;
+  return entry->data[offset];
+}
+
+void write_line_word(cache_entry *entry, int offset, byte value)
+{
+  entry->data[offset] = value;
+}
+
+void init_resource(resource *res, const char *name, int capacity)
+{
+  snprintf(res->name, sizeof(res->name), "%s", name);
+  res->free_at = 0;
+  res->capacity = capacity;
+  res->head = 0;
+  res->count = 0;
+  res->requests = 0;
+  res->busy_cycles = 0;
+  res->wait_cycles = 0;
+  res->completions = (long *)calloc(capacity, sizeof(long));
+  res->depth_histogram = (long *)calloc(capacity + 1, sizeof(long));
+}
+
+void free_resource(resource *res)
+{
+  free(res->completions);
+  free(res->depth_histogram);
+}
+
+// Grant `res` from `start` for `occupancy` cycles to a request that arrived at
+// `arrival` and found `depth` requests queued. Returns the cycle the grant ends.
+long grant_resource(resource *res, long arrival, long start, int occupancy, int depth)
+{
+  res->depth_histogram[depth]++;
+  res->free_at = start + occupancy;
+  res->requests++;
+  res->busy_cycles += occupancy;
+  res->wait_cycles += start - arrival;
+  return res->free_at;
+}
 
-  if (core_cache[core_id][hash].address != instr.address &&
-      (core_cache[core_id][hash].state == Modified ||
-       core_cache[core_id][hash].state == Shared))
+// Queue a request arriving at `arrival` that holds the resource for `occupancy`
+// cycles. A full queue back-pressures the requester: the request is only
+// accepted once the oldest in-flight request completes, and `accepted` is set to
+// that cycle. Returns the cycle at which the request completes.
+long acquire_resource(resource *res, long arrival, int occupancy, long *accepted)
+{
+  // Retire requests that completed before this one arrived.
+  while (res->count > 0 && res->completions[res->head] <= arrival)
+  {
+    res->head = (res->head + 1) % res->capacity;
+    res->count--;
+  }
+  int depth = res->count;
+
+  *accepted = arrival;
+  if (res->count == res->capacity)
+  {
+    *accepted = res->completions[res->head];
+    res->head = (res->head + 1) % res->capacity;
+    res->count--;
+  }
+  long start = *accepted > res->free_at ? *accepted : res->free_at;
+
+  long done = grant_resource(res, arrival, start, occupancy, depth);
+  res->completions[(res->head + res->count) % res->capacity] = done;
+  res->count++;
+  return done;
+}
+
+// Keep the most recent grant of `res` until `until`, e.g. a bus that cannot
+// hand its request on to a full DRAM queue.
+void hold_resource(resource *res, long until)
+{
+  if (until <= res->free_at)
+    return;
+  res->busy_cycles += until - res->free_at;
+  res->free_at = until;
+  if (res->count > 0)
+    res->completions[(res->head + res->count - 1) % res->capacity] = until;
+}
+
+void init_interconnect(interconnect *ic, interconnect_config config, int num_cores)
+{
+  ic->config = config;
+  ic->last_granted = num_cores - 1;
+  init_resource(&ic->bus, "bus", config.queue_capacity);
+  ic->channels = (resource *)calloc(config.dram_channels, sizeof(resource));
+  for (int i = 0; i < config.dram_channels; i++)
   {
-    // Flush current cache entry to memory.
-    global_memory[core_cache[core_id][hash].address] = core_cache[core_id][hash].data;
-    core_cache[core_id][hash].data = global_memory[instr.address];
+    char name[16];
+    snprintf(name, sizeof(name), "dram%d", i);
+    init_resource(&ic->channels[i], name, config.queue_capacity);
   }
+}
+
+void free_interconnect(interconnect *ic)
+{
+  free_resource(&ic->bus);
+  for (int i = 0; i < ic->config.dram_channels; i++)
+    free_resource(&ic->channels[i]);
+  free(ic->channels);
+}
 
-  if (instr.operation == 1)
-  { // Write operation
-    core_cache[core_id][hash].address = instr.address;
-    core_cache[core_id][hash].data = instr.data;
-    core_cache[core_id][hash].state = Modified;
+// Cycle at which an instruction issued at `arrival` completes, given the
+// traffic it generated. Bus transactions start when arbitration grants the bus
+// at `grant`, with `depth` other requests still queued for it. Writebacks and flushes are posted: the core does not
+// wait for them to complete, only for DRAM to accept them. The bus is held until
+// DRAM has accepted every request it carries.
+long transaction_latency(interconnect *ic, long arrival, long grant, int depth, transaction txn, int line)
+{
+  const interconnect_config *cfg = &ic->config;
+  if (!txn.bus)
+    return arrival + cfg->hit_cycles;
+
+  long accepted;
+  long t = grant_resource(&ic->bus, arrival, grant, cfg->bus_cycles, depth);
+  long released = t;
+  long done = t;
+  if (txn.writeback)
+  {
+    acquire_resource(&ic->channels[txn.victim % cfg->dram_channels], t, cfg->dram_cycles, &accepted);
+    if (accepted > released)
+      released = accepted;
+  }
+  if (txn.flush)
+  {
+    acquire_resource(&ic->channels[line % cfg->dram_channels], t, cfg->dram_cycles, &accepted);
+    if (accepted > released)
+      released = accepted;
+  }
+  if (txn.fill)
+  {
+    done = acquire_resource(&ic->channels[line % cfg->dram_channels], t, cfg->dram_cycles, &accepted);
+    if (accepted > released)
+      released = accepted;
+  }
+  hold_resource(&ic->bus, released);
+  return (done > released ? done : released) + cfg->hit_cycles;
+}
 
-    // Invalidate other caches if data is not exclusive.
-    if (core_cache[core_id][hash].state != Exclusive)
+void display_resource_stats(const resource *res, long total_cycles)
+{
+  double utilization = total_cycles ? 100.0 * res->busy_cycles / total_cycles : 0.0;
+  double avg_wait = res->requests ? (double)res->wait_cycles / res->requests : 0.0;
+  printf("\t%-6s requests: %ld, utilization: %.1f%%, avg wait: %.2f cycles\n",
+         res->name, res->requests, utilization, avg_wait);
+  printf("\t\tqueue depth:");
+  for (int d = 0; d <= res->capacity; d++)
+    printf(" %d:%ld", d, res->depth_histogram[d]);
+  printf("\n");
+}
+
+// Cycle at which the last core finishes and every posted transfer has drained.
+long end_cycle(const interconnect *ic, const core_timing *timing, int num_cores)
+{
+  long total_cycles = ic->bus.free_at;
+  for (int i = 0; i < num_cores; i++)
+    if (timing[i].ready_at > total_cycles)
+      total_cycles = timing[i].ready_at;
+  for (int i = 0; i < ic->config.dram_channels; i++)
+    if (ic->channels[i].free_at > total_cycles)
+      total_cycles = ic->channels[i].free_at;
+  return total_cycles;
+}
+
+void display_interconnect_stats(const interconnect *ic, const core_timing *timing, int num_cores)
+{
+  long total_cycles = end_cycle(ic, timing, num_cores);
+
+  printf("Simulated %ld cycles (%s arbitration)\n", total_cycles,
+         ic->config.arbitration == RoundRobin ? "round-robin" : "fixed-priority");
+  for (int i = 0; i < num_cores; i++)
+    printf("\tCore %d finished at cycle %ld, transactions: %ld, stalled: %ld cycles\n",
+           i, timing[i].ready_at, timing[i].transactions, timing[i].stall_cycles);
+  display_resource_stats(&ic->bus, total_cycles);
+  for (int i = 0; i < ic->config.dram_channels; i++)
+    display_resource_stats(&ic->channels[i], total_cycles);
+}
+
+transaction process_instruction(cache_entry **core_cache, const cache_config *cfg, int num_cores,
+                                int core_id, instruction instr)
+{
+  int tag = instr.address / cfg->line_size;
+  int offset = instr.address % cfg->line_size;
+  int index = tag % cfg->num_lines;
+  cache_entry *entry = &core_cache[core_id][index];
+  transaction txn = {false, false, false, false, false, 0, 0};
+  bool hit = entry->tag == tag && entry->state != Invalid;
+  txn.miss = !hit;
+
+  if (!hit)
+  {
+    if (entry->tag != tag && entry->state == Modified)
     {
-      for (int i = 0; i < num_cores; i++)
+      // Flush current line to memory.
+      txn.writeback = true;
+      txn.victim = entry->tag;
+      memcpy(&global_memory[entry->tag * cfg->line_size], entry->data, cfg->line_size);
+    }
+
+    // Fetch the whole line, from a peer holding it if there is one. Every valid
+    // copy of a line is identical, so any peer will do.
+    txn.bus = true;
+    cache_entry *peer = NULL;
+    for (int i = 0; i < num_cores; i++)
+    {
+      if (i == core_id || core_cache[i][index].tag != tag ||
+          core_cache[i][index].state == Invalid)
+        continue;
+      peer = &core_cache[i][index];
+      if (instr.operation == Read && peer->state == Modified)
       {
-        if (i == core_id)
-          continue;
-        if (core_cache[i][hash].address == instr.address)
-        {
-          core_cache[i][hash].state = Invalid;
-        }
+        // Memory must be current once the line is clean-shared.
+        txn.flush = true;
+        memcpy(&global_memory[tag * cfg->line_size], peer->data, cfg->line_size);
       }
+      if (instr.operation == Read)
+        peer->state = Shared;
     }
+    if (peer != NULL)
+    {
+      memcpy(entry->data, peer->data, cfg->line_size);
+      entry->state = Shared;
+    }
+    else
+    {
+      txn.fill = true;
+      memcpy(entry->data, &global_memory[tag * cfg->line_size], cfg->line_size);
+      entry->state = Exclusive;
+    }
+    entry->tag = tag;
   }
-  else
-  { // Read operation
-    if (core_cache[core_id][hash].address != instr.address ||
-        core_cache[core_id][hash].state == Invalid)
+
+  if (instr.operation == Write)
+  {
+    // Only a line already held exclusively can be written without a broadcast.
+    if (entry->state == Shared)
     {
-      bool found = false;
+      txn.bus = true;
       for (int i = 0; i < num_cores; i++)
       {
-        if (i == core_id || core_cache[i][hash].address != instr.address ||
-            core_cache[i][hash].state == Invalid)
+        if (i == core_id || core_cache[i][index].tag != tag || core_cache[i][index].state == Invalid)
           continue;
-        core_cache[core_id][hash] = core_cache[i][hash];
-        core_cache[i][hash].state = Shared;
-        core_cache[core_id][hash].state = Shared;
-        found = true;
-      }
-      if (!found)
-      {
-        core_cache[core_id][hash].data = global_memory[instr.address];
-        core_cache[core_id][hash].state = Exclusive;
-        core_cache[core_id][hash].address = instr.address;
+        core_cache[i][index].state = Invalid;
+        txn.invalidations++;
       }
     }
+    write_line_word(entry, offset, instr.data);
+    entry->state = Modified;
   }
 
+  if (!print_accesses)
+    return txn;
   switch (instr.operation)
   {
-  case 0:
-    printf("Core %d Reading from address %02d: %02d\n", core_id, core_cache[core_id][hash].address, core_cache[core_id][hash].data);
+  case Read:
+    printf("Core %d Reading from address %02d: %02d\n", core_id, instr.address, read_line_word(entry, offset));
     break;
-  case 1:
-    printf("Core %d Writing   to address %02d: %02d\n", core_id, core_cache[core_id][hash].address, core_cache[core_id][hash].data);
+  case Write:
+    printf("Core %d Writing   to address %02d: %02d\n", core_id, instr.address, read_line_word(entry, offset));
     break;
   }
+  return txn;
 }
 
-void cpu_loop(int num_cores)
+void init_checker(checker *chk, check_mode mode, int sample_period, int memory_size)
 {
-  // Allocate memory for cache of each core.
-  cache_entry **core_cache = (cache_entry **)calloc(num_cores, sizeof(cache_entry *));
+  chk->mode = mode;
+  chk->sample_period = sample_period;
+  chk->golden = mode == CheckOff ? NULL : (byte *)calloc(memory_size, sizeof(byte));
+  chk->accesses = 0;
+  chk->checks = 0;
+}
+
+void free_checker(checker *chk)
+{
+  free(chk->golden);
+}
+
+// Print where the run went wrong and the state of every core, then stop.
+void report_violation(const checker *chk, cache_entry **core_cache, const cache_config *cfg,
+                      int num_cores, int core_id, const core_timing *timing, int tag,
+                      const char *message)
+{
+  printf("Coherence violation at access %ld (core %d, line %d of input_%d.txt): %s\n",
+         chk->accesses, core_id, chk->line_number, core_id, message);
+  for (int i = 0; i < num_cores; i++)
+  {
+    printf("\tCore %d (cycle %ld, %ld instructions issued):\n", i, timing[i].ready_at,
+           timing[i].instructions);
+    display_cache_entries(core_cache[i], cfg);
+  }
+  printf("\tLine %d golden:", tag);
+  for (int offset = 0; offset < cfg->line_size; offset++)
+    printf(" %02x", (unsigned char)chk->golden[tag * cfg->line_size + offset]);
+  printf("\n\tLine %d memory:", tag);
+  for (int offset = 0; offset < cfg->line_size; offset++)
+    printf(" %02x", (unsigned char)global_memory[tag * cfg->line_size + offset]);
+  printf("\n");
+  exit(1);
+}
+
+// Validate one line: single writer or multiple readers, every valid copy
+// matches the golden line, and memory matches it whenever no core owns the line
+// dirty.
+void check_line(const checker *chk, cache_entry **core_cache, const cache_config *cfg,
+                int num_cores, int core_id, const core_timing *timing, int tag)
+{
+  int index = tag % cfg->num_lines;
+  const byte *golden = &chk->golden[tag * cfg->line_size];
+  int owners = 0;
+  int sharers = 0;
+  bool dirty = false;
+  char message[96];
+
+  for (int i = 0; i < num_cores; i++)
+  {
+    const cache_entry *entry = &core_cache[i][index];
+    if (entry->tag != tag || entry->state == Invalid)
+      continue;
+    if (entry->state == Shared)
+      sharers++;
+    else
+      owners++;
+    dirty = dirty || entry->state == Modified;
+    if (memcmp(entry->data, golden, cfg->line_size))
+    {
+      snprintf(message, sizeof(message), "core %d holds a stale copy of line %d", i, tag);
+      report_violation(chk, core_cache, cfg, num_cores, core_id, timing, tag, message);
+    }
+  }
+  if (owners > 1 || (owners == 1 && sharers > 0))
+  {
+    snprintf(message, sizeof(message), "line %d has %d exclusive owners and %d sharers",
+             tag, owners, sharers);
+    report_violation(chk, core_cache, cfg, num_cores, core_id, timing, tag, message);
+  }
+  if (!dirty && memcmp(&global_memory[tag * cfg->line_size], golden, cfg->line_size))
+  {
+    snprintf(message, sizeof(message), "memory is stale for line %d with no dirty owner", tag);
+    report_violation(chk, core_cache, cfg, num_cores, core_id, timing, tag, message);
+  }
+}
+
+// Called after each serviced access. Writes always update the golden copy;
+// validation runs on every access in full mode and every Nth in sampled mode.
+void check_access(checker *chk, cache_entry **core_cache, const cache_config *cfg, int num_cores,
+                  int core_id, const core_timing *timing, instruction instr, transaction txn)
+{
+  if (chk->mode == CheckOff)
+    return;
+  chk->accesses++;
+  if (instr.operation == Write)
+    chk->golden[instr.address] = instr.data;
+  if (chk->mode == CheckSampled && chk->accesses % chk->sample_period)
+    return;
+  chk->checks++;
+  chk->line_number = instr.line_number;
+
+  int tag = instr.address / cfg->line_size;
+  const cache_entry *entry = &core_cache[core_id][tag % cfg->num_lines];
+  byte value = read_line_word(entry, instr.address % cfg->line_size);
+  if (value != chk->golden[instr.address])
+  {
+    char message[96];
+    snprintf(message, sizeof(message), "%s of address %d returned %d, expected %d",
+             instr.operation == Read ? "read" : "write", instr.address, value,
+             chk->golden[instr.address]);
+    report_violation(chk, core_cache, cfg, num_cores, core_id, timing, tag, message);
+  }
+  check_line(chk, core_cache, cfg, num_cores, core_id, timing, tag);
+  if (txn.writeback)
+    check_line(chk, core_cache, cfg, num_cores, core_id, timing, txn.victim);
+}
+
+// Remove the status segment if the run is interrupted.
+void remove_status(int sig)
+{
+  shm_unlink(status_name);
+  _exit(128 + sig);
+}
+
+interval_record *ring_record(const status_segment *status, long n)
+{
+  return (interval_record *)(status->records + (n % status->capacity) * status->record_size);
+}
+
+// Create the status segment and open the timeline file (if `path` is set).
+// Returns false, having printed why, if either cannot be set up.
+bool init_timeline(timeline *tl, long interval_accesses, long interval_cycles, const char *path,
+                   int capacity, int num_cores, long total_accesses)
+{
+  memset(tl, 0, sizeof(*tl));
+  tl->interval_accesses = interval_accesses;
+  tl->interval_cycles = interval_cycles;
+  tl->next_access = interval_accesses;
+  tl->next_cycle = interval_cycles;
+  tl->first_event = true;
+
+  size_t record_size = sizeof(interval_record) + num_cores * sizeof(core_interval);
+  tl->status_size = sizeof(status_segment) + capacity * record_size;
+  snprintf(status_name, sizeof(status_name), "/cache_sim_status.%d", (int)getpid());
+  int fd = shm_open(status_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+  {
+    perror("shm_open");
+    return false;
+  }
+  signal(SIGINT, remove_status);
+  signal(SIGTERM, remove_status);
+  if (ftruncate(fd, tl->status_size) < 0)
+  {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(status_name);
+    return false;
+  }
+  tl->status = (status_segment *)mmap(NULL, tl->status_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (tl->status == MAP_FAILED)
+  {
+    perror("mmap");
+    shm_unlink(status_name);
+    return false;
+  }
+  tl->status->num_cores = num_cores;
+  tl->status->capacity = capacity;
+  tl->status->record_size = record_size;
+  tl->status->total_accesses = total_accesses;
+  atomic_init(&tl->status->written, 0);
+  atomic_init(&tl->status->done, 0);
+
+  if (path != NULL)
+  {
+    tl->out = fopen(path, "w");
+    if (tl->out == NULL)
+    {
+      perror(path);
+      munmap(tl->status, tl->status_size);
+      shm_unlink(status_name);
+      return false;
+    }
+    const char *extension = strrchr(path, '.');
+    tl->json = extension != NULL && !strcmp(extension, ".json");
+    if (tl->json)
+      fprintf(tl->out, "{\"otherData\": {\"ts\": \"simulated cycles\"}, \"traceEvents\": [\n");
+    else
+      fprintf(tl->out, "interval,cycle,accesses,core,core_accesses,misses,miss_rate,transactions,"
+                       "invalidations,modified,exclusive,shared,invalid\n");
+  }
+  tl->previous = (core_timing *)calloc(num_cores, sizeof(core_timing));
+  active_timeline = tl;
+  timeline_owner = getpid();
+  printf("Interval stats for run %d, follow with: -W %d\n", (int)getpid(), (int)getpid());
+  return true;
+}
+
+// Write every record not yet in the timeline file.
+void flush_timeline(timeline *tl)
+{
+  for (; tl->flushed < tl->records && tl->out != NULL; tl->flushed++)
+  {
+    const interval_record *rec = ring_record(tl->status, tl->flushed);
+    for (int core_id = 0; core_id < tl->status->num_cores; core_id++)
+    {
+      const core_interval *ci = &rec->cores[core_id];
+      double miss_rate = ci->accesses ? (double)ci->misses / ci->accesses : 0.0;
+      if (tl->json)
+      {
+        fprintf(tl->out,
+                "%s{\"name\": \"core %d\", \"ph\": \"C\", \"ts\": %ld, \"pid\": 1, \"args\": "
+                "{\"miss_rate\": %.4f, \"transactions\": %ld, \"invalidations\": %ld}},\n"
+                "{\"name\": \"core %d lines\", \"ph\": \"C\", \"ts\": %ld, \"pid\": 1, \"args\": "
+                "{\"M\": %d, \"E\": %d, \"S\": %d, \"I\": %d}}",
+                tl->first_event ? "" : ",\n", core_id, rec->cycle, miss_rate, ci->transactions,
+                ci->invalidations, core_id, rec->cycle, ci->lines[Modified], ci->lines[Exclusive],
+                ci->lines[Shared], ci->lines[Invalid]);
+        tl->first_event = false;
+      }
+      else
+      {
+        fprintf(tl->out, "%ld,%ld,%ld,%d,%ld,%ld,%.4f,%ld,%ld,%d,%d,%d,%d\n", rec->index, rec->cycle,
+                rec->accesses, core_id, ci->accesses, ci->misses, miss_rate, ci->transactions,
+                ci->invalidations, ci->lines[Modified], ci->lines[Exclusive], ci->lines[Shared],
+                ci->lines[Invalid]);
+      }
+    }
+  }
+  tl->flushed = tl->records;
+}
+
+// Close the current interval at cycle `now` and publish it to the ring.
+void record_interval(timeline *tl, cache_entry **core_cache, const cache_config *cfg, int num_cores,
+                     const core_timing *timing, long now)
+{
+  // Make room by writing out the records about to be overwritten.
+  if (tl->records - tl->flushed == tl->status->capacity)
+    flush_timeline(tl);
+
+  interval_record *rec = ring_record(tl->status, tl->records);
+  rec->index = tl->records;
+  rec->cycle = now;
+  rec->accesses = tl->accesses;
+  for (int core_id = 0; core_id < num_cores; core_id++)
+  {
+    core_interval *ci = &rec->cores[core_id];
+    core_timing *prev = &tl->previous[core_id];
+    ci->accesses = timing[core_id].instructions - prev->instructions;
+    ci->misses = timing[core_id].misses - prev->misses;
+    ci->transactions = timing[core_id].transactions - prev->transactions;
+    ci->invalidations = timing[core_id].invalidations - prev->invalidations;
+    memset(ci->lines, 0, sizeof(ci->lines));
+    for (int i = 0; i < cfg->num_lines; i++)
+      ci->lines[core_cache[core_id][i].state]++;
+    *prev = timing[core_id];
+  }
+  tl->records++;
+  atomic_store_explicit(&tl->status->written, tl->records, memory_order_release);
+}
+
+// Called after each serviced access issued at cycle `now`.
+void timeline_access(timeline *tl, cache_entry **core_cache, const cache_config *cfg, int num_cores,
+                     const core_timing *timing, long now)
+{
+  if (tl == NULL)
+    return;
+  tl->accesses++;
+  bool due = false;
+  if (tl->interval_accesses && tl->accesses >= tl->next_access)
+  {
+    due = true;
+    tl->next_access += tl->interval_accesses;
+  }
+  if (tl->interval_cycles && now >= tl->next_cycle)
+  {
+    due = true;
+    tl->next_cycle = (now / tl->interval_cycles + 1) * tl->interval_cycles;
+  }
+  if (due)
+    record_interval(tl, core_cache, cfg, num_cores, timing, now);
+}
+
+// Record the trailing partial interval, write out the timeline and tell status
+// readers the run is over.
+void finish_timeline(timeline *tl, cache_entry **core_cache, const cache_config *cfg, int num_cores,
+                     const core_timing *timing, long now)
+{
+  long last = tl->records ? ring_record(tl->status, tl->records - 1)->accesses : 0;
+  if (tl->accesses > last)
+    record_interval(tl, core_cache, cfg, num_cores, timing, now);
+  flush_timeline(tl);
+  atomic_store_explicit(&tl->status->done, 1, memory_order_release);
+}
+
+void free_timeline(timeline *tl)
+{
+  active_timeline = NULL;
+  if (tl->out != NULL)
+  {
+    if (tl->json)
+      fprintf(tl->out, "\n]}\n");
+    fclose(tl->out);
+  }
+  munmap(tl->status, tl->status_size);
+  shm_unlink(status_name);
+  free(tl->previous);
+}
+
+// Registered with atexit, so that a run stopped by exit(), e.g. on a checker
+// violation, still writes out its buffered intervals, terminates the timeline
+// file and removes its status segment.
+void close_active_timeline(void)
+{
+  if (active_timeline == NULL || timeline_owner != getpid())
+    return;
+  flush_timeline(active_timeline);
+  atomic_store_explicit(&active_timeline->status->done, 1, memory_order_release);
+  free_timeline(active_timeline);
+}
+
+// Follow the run with process id `pid`, printing its latest interval once a
+// second until it finishes or exits.
+int watch_status(int pid)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/cache_sim_status.%d", pid);
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+  {
+    printf("No interval stats for run %d\n", pid);
+    return 1;
+  }
+  status_segment header;
+  if (read(fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+  {
+    close(fd);
+    return 1;
+  }
+  size_t size = sizeof(status_segment) + header.capacity * header.record_size;
+  const status_segment *status = (const status_segment *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (status == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+
+  interval_record *rec = (interval_record *)malloc(status->record_size);
+  long shown = 0;
+  while (true)
+  {
+    bool done = atomic_load_explicit(&status->done, memory_order_acquire);
+    long written = atomic_load_explicit(&status->written, memory_order_acquire);
+    if (written > shown)
+    {
+      // Copy the newest record, and retry if the writer lapped us meanwhile.
+      memcpy(rec, ring_record(status, written - 1), status->record_size);
+      if (atomic_load_explicit(&status->written, memory_order_acquire) - written >= status->capacity - 1)
+        continue;
+      shown = written;
+      printf("Run %d: interval %ld, cycle %ld, %ld/%ld accesses (%.1f%%)\n", pid, rec->index,
+             rec->cycle, rec->accesses, status->total_accesses,
+             status->total_accesses ? 100.0 * rec->accesses / status->total_accesses : 100.0);
+      for (int core_id = 0; core_id < status->num_cores; core_id++)
+      {
+        const core_interval *ci = &rec->cores[core_id];
+        printf("\tCore %d: miss rate %.1f%%, transactions: %ld, invalidations: %ld, M/E/S/I: %d/%d/%d/%d\n",
+               core_id, ci->accesses ? 100.0 * ci->misses / ci->accesses : 0.0, ci->transactions,
+               ci->invalidations, ci->lines[Modified], ci->lines[Exclusive], ci->lines[Shared],
+               ci->lines[Invalid]);
+      }
+      fflush(stdout);
+    }
+    if (done)
+      break;
+    if (kill(pid, 0) < 0 && errno == ESRCH)
+    {
+      printf("Run %d exited without finishing\n", pid);
+      free(rec);
+      munmap((void *)status, size);
+      return 1;
+    }
+    sleep(1);
+  }
+  printf("Run %d finished\n", pid);
+  free(rec);
+  munmap((void *)status, size);
+  return 0;
+}
+
+// Whether `instr` needs the bus: a miss, or a write to a line held Shared.
+bool needs_bus(cache_entry **core_cache, const cache_config *cfg, int core_id, instruction instr)
+{
+  int tag = instr.address / cfg->line_size;
+  const cache_entry *entry = &core_cache[core_id][tag % cfg->num_lines];
+  if (entry->tag != tag || entry->state == Invalid)
+    return true;
+  return instr.operation == Write && entry->state == Shared;
+}
+
+// Execute the pending instruction of `core_id`, starting at `start`.
+void issue_instruction(cache_entry **core_cache, const cache_config *cfg, int num_cores, interconnect *ic,
+                       checker *chk, timeline *tl, instruction *pending, bool *has_pending,
+                       core_timing *timing, int core_id, long start, int depth)
+{
+  long arrival = timing[core_id].ready_at;
+  transaction txn = process_instruction(core_cache, cfg, num_cores, core_id, pending[core_id]);
+  timing[core_id].instructions++;
+  if (txn.miss)
+    timing[core_id].misses++;
+  timing[core_id].invalidations += txn.invalidations;
+  check_access(chk, core_cache, cfg, num_cores, core_id, timing, pending[core_id], txn);
+  long done = transaction_latency(ic, arrival, start, depth, txn, pending[core_id].address / cfg->line_size);
+  if (txn.bus)
+    timing[core_id].transactions++;
+  timing[core_id].stall_cycles += done - arrival - ic->config.hit_cycles;
+  timing[core_id].ready_at = done;
+  has_pending[core_id] = false;
+  timeline_access(tl, core_cache, cfg, num_cores, timing, start);
+}
+
+// Serve the next event in simulated time: either every core whose pending
+// instruction hits at the earliest such cycle, or the winner of bus arbitration.
+// The bus is arbitrated when it next becomes free, among every core whose
+// request has arrived by then. Only the `queue_capacity` earliest arrivals are
+// queued; later ones wait at the core until a slot frees. Returns false once no
+// core has anything left to issue.
+bool service_requests(cache_entry **core_cache, const cache_config *cfg, int num_cores, interconnect *ic,
+                      checker *chk, timeline *tl, instruction *pending, bool *has_pending, core_timing *timing)
+{
+  bool bus_needed[MAX_CORES];
+  long hit_at = -1;
+  long bus_at = -1;
   for (int i = 0; i < num_cores; i++)
   {
-    *(core_cache + i) = (cache_entry *)calloc(CACHE_SIZE, sizeof(cache_entry));
+    if (!has_pending[i])
+      continue;
+    bus_needed[i] = needs_bus(core_cache, cfg, i, pending[i]);
+    long *earliest = bus_needed[i] ? &bus_at : &hit_at;
+    if (*earliest < 0 || timing[i].ready_at < *earliest)
+      *earliest = timing[i].ready_at;
+  }
+  if (hit_at < 0 && bus_at < 0)
+    return false;
+  long grant = bus_at < 0 || bus_at > ic->bus.free_at ? bus_at : ic->bus.free_at;
+
+  // Hits never touch the interconnect, so they go first if they are due by the
+  // next grant.
+  if (hit_at >= 0 && (bus_at < 0 || hit_at <= grant))
+  {
+    for (int i = 0; i < num_cores; i++)
+    {
+      if (has_pending[i] && !bus_needed[i] && timing[i].ready_at == hit_at)
+        issue_instruction(core_cache, cfg, num_cores, ic, chk, tl, pending, has_pending, timing, i, hit_at, 0);
+    }
+    return true;
   }
 
-#pragma omp parallel num_threads(num_cores)
+  // A request is queued if fewer than `queue_capacity` requests arrived before
+  // it (earlier core first on a tie).
+  bool queued[MAX_CORES];
+  int depth = 0;
+  for (int i = 0; i < num_cores; i++)
+  {
+    queued[i] = false;
+    if (!has_pending[i] || !bus_needed[i] || timing[i].ready_at > grant)
+      continue;
+    int ahead = 0;
+    for (int j = 0; j < num_cores; j++)
+    {
+      if (j != i && has_pending[j] && bus_needed[j] &&
+          (timing[j].ready_at < timing[i].ready_at || (timing[j].ready_at == timing[i].ready_at && j < i)))
+        ahead++;
+    }
+    queued[i] = ahead < ic->config.queue_capacity;
+    if (queued[i])
+      depth++;
+  }
+
+  // Round-robin starts after the last winner; fixed priority always favours core 0.
+  int first = ic->config.arbitration == RoundRobin ? (ic->last_granted + 1) % num_cores : 0;
+  for (int n = 0; n < num_cores; n++)
+  {
+    int core_id = (first + n) % num_cores;
+    if (!queued[core_id])
+      continue;
+    ic->last_granted = core_id;
+    issue_instruction(core_cache, cfg, num_cores, ic, chk, tl, pending, has_pending, timing, core_id, grant,
+                      depth - 1);
+    break;
+  }
+  return true;
+}
+
+// Read and decode input_0.txt .. input_<num_cores - 1>.txt into one block.
+trace_set *decode_traces(int num_cores)
+{
+  instruction *streams[MAX_CORES] = {NULL};
+  long lengths[MAX_CORES] = {0};
+  long total = 0;
+  int min_address = 0;
+  int max_address = 0;
+
+  for (int core_id = 0; core_id < num_cores; core_id++)
   {
-    int core_id = omp_get_thread_num();
     char file_name[20];
     sprintf(file_name, "input_%d.txt", core_id);
     printf("Processing file: %s\n", file_name);
@@ -184,24 +1144,589 @@ void cpu_loop(int num_cores)
     if (input_file == NULL)
     {
       printf("Failed to open file: %s\n", file_name);
-      exit(0); // Exiting the loop within the parallel region
+      for (int i = 0; i < core_id; i++)
+        free(streams[i]);
+      return NULL;
     }
+    long capacity = 64;
+    streams[core_id] = (instruction *)malloc(capacity * sizeof(instruction));
     char line[20];
-
+    int line_number = 0;
+    bool line_start = true;
     while (fgets(line, sizeof(line), input_file))
     {
-      instruction instr = parse_instruction(line);
-      process_instruction(core_cache, num_cores, core_id, instr);
+      // A line longer than the buffer arrives in pieces; only the first piece
+      // can hold an instruction.
+      bool starts_line = line_start;
+      line_start = strchr(line, '\n') != NULL;
+      if (!starts_line)
+        continue;
+      line_number++;
+      if (lengths[core_id] == capacity)
+      {
+        capacity *= 2;
+        streams[core_id] = (instruction *)realloc(streams[core_id], capacity * sizeof(instruction));
+      }
+      instruction instr;
+      if (!parse_instruction(line, &instr))
+        continue;
+      instr.line_number = line_number;
+      if (instr.address < min_address)
+        min_address = instr.address;
+      if (instr.address > max_address)
+        max_address = instr.address;
+      streams[core_id][lengths[core_id]++] = instr;
     }
     fclose(input_file);
-    free(core_cache[core_id]);
+    total += lengths[core_id];
+  }
+
+  size_t size = sizeof(trace_set) + total * sizeof(instruction);
+  trace_set *traces = (trace_set *)calloc(1, size);
+  traces->size = size;
+  traces->num_cores = num_cores;
+  traces->min_address = min_address;
+  traces->max_address = max_address;
+  long offset = 0;
+  for (int core_id = 0; core_id < num_cores; core_id++)
+  {
+    traces->lengths[core_id] = lengths[core_id];
+    traces->offsets[core_id] = offset;
+    memcpy(&traces->instructions[offset], streams[core_id], lengths[core_id] * sizeof(instruction));
+    offset += lengths[core_id];
+    free(streams[core_id]);
+  }
+  return traces;
+}
+
+// Run one configuration against the decoded traces. With `report` set, per-core and per-resource stats are printed at the end.
+// `tl`, if not NULL, receives interval stats.
+sim_result simulate(const trace_set *traces, sim_config config, bool report, timeline *tl)
+{
+  int num_cores = config.num_cores;
+  cache_config cache_cfg = config.cache;
+  // Round memory up to whole lines.
+  cache_cfg.memory_size = (cache_cfg.memory_size + cache_cfg.line_size - 1) / cache_cfg.line_size * cache_cfg.line_size;
+  global_memory = (byte *)calloc(cache_cfg.memory_size, sizeof(byte));
+  checker chk;
+  init_checker(&chk, config.check, config.sample_period, cache_cfg.memory_size);
+
+  // Allocate memory for cache of each core. Line data for every core lives in
+  // one arena so that lines are contiguous and need no per-entry allocation.
+  cache_entry **core_cache = (cache_entry **)calloc(num_cores, sizeof(cache_entry *));
+  byte *line_arena = (byte *)calloc((size_t)num_cores * cache_cfg.num_lines, cache_cfg.line_size);
+  for (int i = 0; i < num_cores; i++)
+  {
+    *(core_cache + i) = (cache_entry *)calloc(cache_cfg.num_lines, sizeof(cache_entry));
+    for (int j = 0; j < cache_cfg.num_lines; j++)
+      core_cache[i][j].data = line_arena + ((size_t)i * cache_cfg.num_lines + j) * cache_cfg.line_size;
   }
+
+  interconnect ic;
+  init_interconnect(&ic, config.interconnect, num_cores);
+  instruction *pending = (instruction *)calloc(num_cores, sizeof(instruction));
+  bool *has_pending = (bool *)calloc(num_cores, sizeof(bool));
+  long *next = (long *)calloc(num_cores, sizeof(long));
+  core_timing *timing = (core_timing *)calloc(num_cores, sizeof(core_timing));
+  bool all_done = false;
+
+  while (!all_done)
+  {
+    // Each core fetches its next instruction once the previous one has issued.
+    for (int core_id = 0; core_id < num_cores; core_id++)
+    {
+      if (!has_pending[core_id] && next[core_id] < traces->lengths[core_id])
+      {
+        pending[core_id] = traces->instructions[traces->offsets[core_id] + next[core_id]++];
+        has_pending[core_id] = true;
+      }
+    }
+    // Shared cache state and the interconnect are only touched here, one
+    // request at a time, in simulated-time order.
+    all_done = !service_requests(core_cache, &cache_cfg, num_cores, &ic, &chk, tl, pending, has_pending, timing);
+  }
+
+  sim_result result = {0};
+  result.cycles = end_cycle(&ic, timing, num_cores);
+  if (tl != NULL)
+    finish_timeline(tl, core_cache, &cache_cfg, num_cores, timing, result.cycles);
+  for (int i = 0; i < num_cores; i++)
+  {
+    result.accesses += timing[i].instructions;
+    result.misses += timing[i].misses;
+  }
+  result.bus_requests = ic.bus.requests;
+  result.bus_busy_cycles = ic.bus.busy_cycles;
+  result.bus_wait_cycles = ic.bus.wait_cycles;
+  for (int i = 0; i < ic.config.dram_channels; i++)
+    result.dram_busy_cycles += ic.channels[i].busy_cycles;
+
+  if (report)
+  {
+    display_interconnect_stats(&ic, timing, num_cores);
+    if (chk.mode != CheckOff)
+      printf("Coherence checker: %ld of %ld accesses validated, no violations\n", chk.checks, chk.accesses);
+  }
+  free_interconnect(&ic);
+  free(pending);
+  free(has_pending);
+  free(next);
+  free(timing);
+  for (int i = 0; i < num_cores; i++)
+    free(core_cache[i]);
+  free(line_arena);
   free(core_cache);
+  free_checker(&chk);
+  free(global_memory);
+  return result;
+}
+
+// Returns a description of what is wrong with `config`, or NULL if it can run.
+const char *validate_config(const sim_config *config, const trace_set *traces)
+{
+  const cache_config *cache_cfg = &config->cache;
+  if (config->num_cores < 1 || config->num_cores > traces->num_cores)
+    return "core count must be between 1 and the number of decoded traces";
+  if (cache_cfg->line_size < 1 || (cache_cfg->line_size & (cache_cfg->line_size - 1)))
+    return "line size must be a power of two";
+  if (cache_cfg->num_lines < 1)
+    return "line count must be positive";
+  if (traces->min_address < 0)
+    return "trace addresses must not be negative";
+  if (cache_cfg->memory_size <= traces->max_address)
+    return "trace addresses exceed memory size";
+  if (config->interconnect.dram_channels < 1 || config->interconnect.queue_capacity < 1)
+    return "DRAM channels and queue capacity must be positive";
+  if (config->interconnect.bus_cycles < 1 || config->interconnect.dram_cycles < 1)
+    return "bus and DRAM cycles must be positive";
+  if (config->sample_period < 1)
+    return "sample period must be positive";
+  if (config->interconnect.arbitration != RoundRobin && config->interconnect.arbitration != FixedPriority)
+    return "arbitration must be rr or priority";
+  return NULL;
+}
+
+void set_parameter(sim_config *config, sweep_parameter param, int value)
+{
+  switch (param)
+  {
+  case ParamCores:
+    config->num_cores = value;
+    break;
+  case ParamLineSize:
+    config->cache.line_size = value;
+    break;
+  case ParamLines:
+    config->cache.num_lines = value;
+    break;
+  case ParamBusCycles:
+    config->interconnect.bus_cycles = value;
+    break;
+  case ParamDramCycles:
+    config->interconnect.dram_cycles = value;
+    break;
+  case ParamChannels:
+    config->interconnect.dram_channels = value;
+    break;
+  case ParamQueue:
+    config->interconnect.queue_capacity = value;
+    break;
+  case ParamArbitration:
+    config->interconnect.arbitration = (arbitration_policy)value;
+    break;
+  case NumParams:
+    break;
+  }
+}
+
+// The `job`-th point of the cartesian product of all axes. Parameters with no
+// values given keep their value in `base`.
+sim_config config_for_job(sim_config base, const sweep_axis *axes, int job)
+{
+  for (int param = 0; param < NumParams; param++)
+  {
+    if (axes[param].count == 0)
+      continue;
+    set_parameter(&base, (sweep_parameter)param, axes[param].values[job % axes[param].count]);
+    job /= axes[param].count;
+  }
+  return base;
+}
+
+// Parse the first `length` characters of `arg` as a decimal number. Returns
+// false unless they form exactly one number.
+bool parse_number(const char *arg, size_t length, long *number)
+{
+  char *parsed;
+  errno = 0;
+  *number = strtol(arg, &parsed, 10);
+  return length > 0 && parsed == arg + length && errno == 0;
+}
+
+// Parse all of `arg` as an int.
+bool parse_int(const char *arg, int *value)
+{
+  long number;
+  if (!parse_number(arg, strlen(arg), &number) || number < INT_MIN || number > INT_MAX)
+    return false;
+  *value = (int)number;
+  return true;
+}
+
+// Parse a comma-separated list of values into `axis`: integers, or with
+// `policies` set, arbitration policy names (rr, priority). Returns false if it
+// is empty, has too many values or a value of the wrong kind.
+bool parse_axis(const char *arg, sweep_axis *axis, bool policies)
+{
+  axis->count = 0;
+  const char *value = arg;
+  while (*value)
+  {
+    if (axis->count == MAX_SWEEP_VALUES)
+      return false;
+    const char *end = strchr(value, ',');
+    size_t length = end ? (size_t)(end - value) : strlen(value);
+    if (policies && length == 2 && !strncmp(value, "rr", length))
+      axis->values[axis->count++] = RoundRobin;
+    else if (policies && length == 8 && !strncmp(value, "priority", length))
+      axis->values[axis->count++] = FixedPriority;
+    else if (policies)
+      return false;
+    else
+    {
+      long number;
+      if (!parse_number(value, length, &number) || number < INT_MIN || number > INT_MAX)
+        return false;
+      axis->values[axis->count++] = (int)number;
+    }
+    value = end ? end + 1 : value + length;
+  }
+  return axis->count > 0;
+}
+
+void worker_loop(const trace_set *traces, sweep_state *state)
+{
+  int job;
+  while ((job = atomic_fetch_add(&state->next_job, 1)) < state->num_jobs)
+  {
+    sweep_job *sj = &state->jobs[job];
+    sj->worker = getpid();
+    sj->status = JobRunning;
+    sj->result = simulate(traces, sj->config, false, NULL);
+    sj->status = JobDone;
+  }
+}
+
+void display_sweep_results(const sweep_state *state)
+{
+  printf("%5s %5s %5s %4s %5s %5s %5s %-8s %10s %8s %8s %6s %6s %8s\n", "cores", "line", "lines",
+         "bus", "dram", "chans", "queue", "arb", "cycles", "accesses", "misses", "bus%", "dram%",
+         "bus wait");
+  for (int job = 0; job < state->num_jobs; job++)
+  {
+    const sweep_job *sj = &state->jobs[job];
+    const sim_config *c = &sj->config;
+    const sim_result *r = &sj->result;
+    printf("%5d %5d %5d %4d %5d %5d %5d %-8s ", c->num_cores, c->cache.line_size, c->cache.num_lines,
+           c->interconnect.bus_cycles, c->interconnect.dram_cycles, c->interconnect.dram_channels,
+           c->interconnect.queue_capacity, c->interconnect.arbitration == RoundRobin ? "rr" : "priority");
+    if (sj->status != JobDone)
+    {
+      printf("%10s\n", "failed");
+      continue;
+    }
+    double cycles = r->cycles ? (double)r->cycles : 1.0;
+    printf("%10ld %8ld %8ld %5.1f%% %5.1f%% %8.2f\n", r->cycles, r->accesses, r->misses,
+           100.0 * r->bus_busy_cycles / cycles,
+           100.0 * r->dram_busy_cycles / c->interconnect.dram_channels / cycles,
+           r->bus_requests ? (double)r->bus_wait_cycles / r->bus_requests : 0.0);
+  }
+}
+
+// Copy the decoded traces into a POSIX shared-memory segment, fork `workers`
+// processes that pull configurations from a shared job counter, and print one
+// row per configuration once they have all exited. Returns the number of
+// configurations that did not complete. Takes ownership of `local` and frees
+// it as soon as it is copied, so workers and driver share the only copy.
+int run_sweep(trace_set *local, sim_config base, const sweep_axis *axes, int num_jobs, int workers)
+{
+  size_t size = local->size;
+  char shm_name[32];
+  snprintf(shm_name, sizeof(shm_name), "/cache_sim_trace.%d", (int)getpid());
+  int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+  {
+    perror("shm_open");
+    free(local);
+    return num_jobs;
+  }
+  // The mapping outlives the name, so unlink straight away and leave nothing
+  // behind if the run is killed.
+  shm_unlink(shm_name);
+  if (ftruncate(fd, size) < 0)
+  {
+    perror("ftruncate");
+    close(fd);
+    free(local);
+    return num_jobs;
+  }
+  trace_set *traces = (trace_set *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (traces == MAP_FAILED)
+  {
+    perror("mmap");
+    free(local);
+    return num_jobs;
+  }
+  memcpy(traces, local, size);
+  free(local);
+  mprotect(traces, size, PROT_READ);
+
+  size_t state_size = sizeof(sweep_state) + num_jobs * sizeof(sweep_job);
+  sweep_state *state = (sweep_state *)mmap(NULL, state_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (state == MAP_FAILED)
+  {
+    perror("mmap");
+    munmap(traces, size);
+    return num_jobs;
+  }
+  atomic_init(&state->next_job, 0);
+  state->num_jobs = num_jobs;
+  for (int job = 0; job < num_jobs; job++)
+  {
+    state->jobs[job].config = config_for_job(base, axes, job);
+    state->jobs[job].status = JobPending;
+  }
+
+  printf("Sweeping %d configurations over %d workers\n", num_jobs, workers);
+  fflush(stdout);
+  int started = 0;
+  for (int i = 0; i < workers; i++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      worker_loop(traces, state);
+      fflush(stdout);
+      _exit(0);
+    }
+    if (pid < 0)
+      perror("fork");
+    else
+      started++;
+  }
+  for (int i = 0; i < started; i++)
+  {
+    int status;
+    pid_t pid = wait(&status);
+    if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+      printf("Worker %d exited abnormally\n", (int)pid);
+  }
+
+  display_sweep_results(state);
+  int failed = 0;
+  for (int job = 0; job < num_jobs; job++)
+    if (state->jobs[job].status != JobDone)
+      failed++;
+  munmap(state, state_size);
+  munmap(traces, size);
+  return failed;
 }
 
 int main(int argc, char *argv[])
 {
-  global_memory = (byte *)calloc(MEMORY_SIZE, sizeof(byte));
-  cpu_loop(2);
-  free(global_memory);
+  sim_config base = {NUM_CORES,
+                     {LINE_SIZE, CACHE_SIZE, MEMORY_SIZE},
+                     {HIT_CYCLES, BUS_CYCLES, DRAM_CYCLES, DRAM_CHANNELS, QUEUE_CAPACITY, RoundRobin},
+                     CheckOff,
+                     SAMPLE_PERIOD};
+  sweep_axis axes[NumParams] = {{{0}, 0}};
+  bool sweep = false;
+  int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  long interval_accesses = 0;
+  long interval_cycles = 0;
+  int ring_capacity = RING_CAPACITY;
+  const char *timeline_path = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:l:n:m:a:b:d:c:q:k:s:Sw:i:I:o:r:W:")) != -1)
+  {
+    bool ok = true;
+    switch (opt)
+    {
+    case 'W':
+    {
+      int pid;
+      if (!parse_int(optarg, &pid))
+      {
+        ok = false;
+        break;
+      }
+      return watch_status(pid);
+    }
+    case 'i':
+      ok = parse_number(optarg, strlen(optarg), &interval_accesses);
+      break;
+    case 'I':
+      ok = parse_number(optarg, strlen(optarg), &interval_cycles);
+      break;
+    case 'o':
+      timeline_path = optarg;
+      break;
+    case 'r':
+      ok = parse_int(optarg, &ring_capacity);
+      break;
+    case 'p':
+      ok = parse_axis(optarg, &axes[ParamCores], false);
+      break;
+    case 'l':
+      ok = parse_axis(optarg, &axes[ParamLineSize], false);
+      break;
+    case 'n':
+      ok = parse_axis(optarg, &axes[ParamLines], false);
+      break;
+    case 'a':
+      ok = parse_axis(optarg, &axes[ParamArbitration], true);
+      break;
+    case 'b':
+      ok = parse_axis(optarg, &axes[ParamBusCycles], false);
+      break;
+    case 'd':
+      ok = parse_axis(optarg, &axes[ParamDramCycles], false);
+      break;
+    case 'c':
+      ok = parse_axis(optarg, &axes[ParamChannels], false);
+      break;
+    case 'q':
+      ok = parse_axis(optarg, &axes[ParamQueue], false);
+      break;
+    case 'm':
+      ok = parse_int(optarg, &base.cache.memory_size);
+      break;
+    case 'k':
+      if (!strcmp(optarg, "full"))
+        base.check = CheckFull;
+      else if (!strcmp(optarg, "sampled"))
+        base.check = CheckSampled;
+      else if (!strcmp(optarg, "off"))
+        base.check = CheckOff;
+      else
+        ok = false;
+      break;
+    case 's':
+      ok = parse_int(optarg, &base.sample_period);
+      break;
+    case 'S':
+      sweep = true;
+      break;
+    case 'w':
+      ok = parse_int(optarg, &workers);
+      break;
+    default:
+      ok = false;
+      break;
+    }
+    if (!ok)
+    {
+      fprintf(stderr, "Usage: %s [-S [-w workers]] [-p num_cores] [-l line_size] [-n num_lines] [-m memory_size] "
+                      "[-a rr|priority] [-b bus_cycles] [-d dram_cycles] [-c dram_channels] [-q queue_capacity] "
+                      "[-k off|sampled|full] [-s sample_period] [-i interval_accesses] [-I interval_cycles] "
+                      "[-o timeline.csv|timeline.json] [-r ring_capacity]\n"
+                      "       %s -W pid\n"
+                      "With -S, -p -l -n -a -b -d -c -q each take a comma-separated list and all combinations are run.\n",
+              argv[0], argv[0]);
+      return 1;
+    }
+  }
+
+  int num_jobs = 1;
+  int max_cores = base.num_cores;
+  for (int param = 0; param < NumParams; param++)
+  {
+    if (axes[param].count > 0)
+      num_jobs *= axes[param].count;
+  }
+  for (int i = 0; i < axes[ParamCores].count; i++)
+  {
+    if (i == 0 || axes[ParamCores].values[i] > max_cores)
+      max_cores = axes[ParamCores].values[i];
+  }
+  if (!sweep && num_jobs > 1)
+  {
+    fprintf(stderr, "Lists of values need -S\n");
+    return 1;
+  }
+  bool sampling = interval_accesses > 0 || interval_cycles > 0;
+  if (timeline_path != NULL && !sampling)
+  {
+    fprintf(stderr, "A timeline needs -i or -I\n");
+    return 1;
+  }
+  if (sweep && sampling)
+  {
+    fprintf(stderr, "Interval stats are not available with -S\n");
+    return 1;
+  }
+  if (interval_accesses < 0 || interval_cycles < 0 || ring_capacity < 2)
+  {
+    fprintf(stderr, "Intervals must be positive and the ring must hold at least 2 records\n");
+    return 1;
+  }
+  if (max_cores < 1 || max_cores > MAX_CORES)
+  {
+    fprintf(stderr, "Core count must be between 1 and %d\n", MAX_CORES);
+    return 1;
+  }
+
+  trace_set *traces = decode_traces(max_cores);
+  if (traces == NULL)
+    return 1;
+  for (int job = 0; job < num_jobs; job++)
+  {
+    sim_config config = config_for_job(base, axes, job);
+    const char *error = validate_config(&config, traces);
+    if (error != NULL)
+    {
+      fprintf(stderr, "Invalid configuration: %s\n", error);
+      free(traces);
+      return 1;
+    }
+  }
+
+  int status = 0;
+  if (sweep)
+  {
+    if (workers < 1)
+      workers = 1;
+    if (workers > num_jobs)
+      workers = num_jobs;
+    print_accesses = false;
+    status = run_sweep(traces, base, axes, num_jobs, workers) ? 1 : 0;
+    traces = NULL;
+  }
+  else
+  {
+    sim_config config = config_for_job(base, axes, 0);
+    timeline tl;
+    if (sampling)
+    {
+      // Interval stats replace the per-access log, which dominates long runs.
+      print_accesses = false;
+      long total_accesses = 0;
+      for (int i = 0; i < config.num_cores; i++)
+        total_accesses += traces->lengths[i];
+      if (!init_timeline(&tl, interval_accesses, interval_cycles, timeline_path, ring_capacity,
+                         config.num_cores, total_accesses))
+      {
+        free(traces);
+        return 1;
+      }
+      atexit(close_active_timeline);
+    }
+    simulate(traces, config, true, sampling ? &tl : NULL);
+    if (sampling)
+      free_timeline(&tl);
+  }
+  free(traces);
+  return status;
 }
\ No newline at end of file